@@ -3,10 +3,22 @@
 #define USE_NEO_PIXEL
 //#define USE_8DIGIT_DISPLAY
 #define USE_OLED_MONO // If OLED MONO connected to I2C bus
+//#define USE_AC_CYCLE_DETECT // Find waveforms with the analog comparator and TC capture (jumper A2 to A3)
+//#define USE_SELF_TEST       // DAC sine sweep and accuracy report (jumper A0 to A2), see self_test.h
 
 /*
  * Specify ADC precision
 */
 //#define ADC_8BITS
 #define ADC_10BITS
-//#define ADC_12BITS
\ No newline at end of file
+//#define ADC_12BITS
+
+//#define USE_TIMED_SAMPLING  // TC5 triggers each ADC conversion at exactly SAMPLE_RATE (sam_adc.h)
+
+/*
+ * Optional per sample filters ahead of the peak detection, see sam_filter.h
+ * The filters need USE_TIMED_SAMPLING, PROFILE_FILTER needs at least one filter
+*/
+//#define USE_DC_BLOCK        // remove DC drift
+//#define USE_PL_HIGHPASS     // 300 Hz high pass to remove PL / CTCSS tones
+//#define PROFILE_FILTER      // print the worst case filter cost in CPU cycles
\ No newline at end of file
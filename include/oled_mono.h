@@ -1,5 +1,5 @@
 #include "global_def.h"
 
-void update_oled_mono(float maxDev, float avgDC);
+void update_oled_mono(float maxDev, float avgDC, float rmsDev);
 void init_oled_mono();
 
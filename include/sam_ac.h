@@ -0,0 +1,33 @@
+#include <Arduino.h>
+#include "global_def.h"
+
+#ifndef AC_MODULE
+#define AC_MODULE
+
+/*
+ * Hardware cycle detection
+ *   - Analog comparator 0 compares the input with a mid level reference (with hysteresis)
+ *   - The comparator output is routed through the event system to TC4 in period capture
+ *     mode so each rising crossing timestamps itself, no CPU involvement
+ *   - The ADC ISR only polls the TC capture flag to know when a cycle has ended
+ *
+ * NOTE: A2 (PB09) is not an AC input.  Jumper A2 to A3 (PA04 / AC AIN0) so the comparator
+ *       sees the same signal as the ADC.
+*/
+
+//#define AC_REF_DAC                     // Uncomment to use the DAC (internal only) as the mid level
+#define AC_VSCALE_MID 31                 // VDD scaler reference, VDD * (31 + 1) / 64 = Vcc / 2
+#define AC_DAC_MID 512                   // DAC reference value (10 bits, AVCC reference) = Vcc / 2
+
+#define AC_CAPTURE_TC TC4                // TC used for period capture
+#define AC_TC_PRESCALER TC_CTRLA_PRESCALER_DIV4
+#define AC_TC_HZ (F_CPU / 4)             // 12 MHz capture clock, lowest frequency ~183 Hz
+
+#define EVSYS_CH_AC_CAPTURE 0            // event channel, comparator -> TC capture
+
+void init_ac_cycle_detect();
+
+extern uint32_t wfPeriodAccumulator;     // sum of captured cycle periods (AC_TC_HZ ticks)
+extern int wfPeriodCount;                // count of captured cycle periods
+
+#endif
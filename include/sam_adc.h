@@ -29,6 +29,12 @@ extern int adcMax,
 extern int winMax,         // maximum ADC value during sample window
            winMin;         // minimum ADC value during sample window
 
+extern uint64_t winSumSq;  // sum of squared sample deviations from the running DC mean
+extern int32_t winSumDev;  // sum of sample deviations from the running DC mean
+
+uint32_t isqrt64(uint64_t value);
+uint32_t window_rms_x16(uint64_t sumSq, int32_t sumDev, int count);
+
 // Moved to global_def.h
 //#define ADC_8BITS
 //#define ADC_10BITS
@@ -54,4 +60,9 @@ extern volatile bool displayReady;
                               // Display update is now a function of the sample window AND
                               // the [experimental] sliding average window code in the main loop
 
+#define SAMPLE_RATE 24000     // ADC samples / second with USE_TIMED_SAMPLING, must divide 48 MHz
+                              // exactly.  See sample_plan.h for the ADC settings it produces
+
+#define EVSYS_CH_ADC_START 1  // event channel, TC5 overflow -> ADC start conversion
+
 #endif
\ No newline at end of file
@@ -0,0 +1,130 @@
+#include <Arduino.h>
+#include "global_def.h"
+#include "sam_adc.h"          // SAMPLE_RATE
+
+#ifndef FILTER_MODULE
+#define FILTER_MODULE
+
+/*
+ * Per sample filter stage, runs in the ADC ISR before the peak detection
+ *   - USE_DC_BLOCK     first order DC blocker, removes DC drift and the bias voltage
+ *   - USE_PL_HIGHPASS  second order (Butterworth) high pass biquad, removes PL / CTCSS tones
+ *
+ * Everything is integer.  Coefficients are worked out at compile time for SAMPLE_RATE so
+ * the filters need USE_TIMED_SAMPLING, the free run rate is only approx 23K and would put
+ * the corners somewhere else.
+ * The filtered sample is centred back on ADC_BITS / 2 and feeds the waveform detector and
+ * the RMS sums.  The window DC average and adcMax / adcMin keep the raw ADC values.
+ *
+ * PROFILE_FILTER (global_def.h) uses SysTick to record the worst case filter cost in CPU
+ * cycles during each sample window (filterCycles, includes a couple of cycles for the
+ * SysTick reads) and prints it with the serial telemetry.
+ * NOTE: the cycle cost has not been measured on hardware yet, build with PROFILE_FILTER
+ *       and USE_DC_BLOCK only, USE_PL_HIGHPASS only and both to get the figures.
+*/
+
+#define DC_BLOCK_HZ 15           // DC blocker corner, rounded to the nearest power of two shift
+#define PL_HIGHPASS_HZ 300       // high pass corner, CTCSS tones are 67 - 254 Hz
+#define PL_HIGHPASS_Q 0.7071     // Butterworth
+
+#if defined(USE_DC_BLOCK) || defined(USE_PL_HIGHPASS)
+#define USE_SAMPLE_FILTER
+#endif
+
+#if defined(USE_SAMPLE_FILTER) && !defined(USE_TIMED_SAMPLING)
+#error "USE_DC_BLOCK / USE_PL_HIGHPASS need USE_TIMED_SAMPLING, the coefficients assume SAMPLE_RATE"
+#endif
+
+namespace sample_filter {
+
+#if defined(ADC_12BITS)
+constexpr int MID = 2048;
+#elif defined(ADC_10BITS)
+constexpr int MID = 512;
+#else
+constexpr int MID = 128;
+#endif
+
+constexpr double PI_2 = 6.283185307179586;
+
+// Taylor series, good to double precision for the small angles used here
+constexpr double cos_series(double x2, double term, int n) {
+  return n > 12 ? 0 : term + cos_series(x2, -term * x2 / ((2 * n + 1) * (2 * n + 2)), n + 1);
+}
+constexpr double sin_series(double x2, double term, int n) {
+  return n > 12 ? 0 : term + sin_series(x2, -term * x2 / ((2 * n + 2) * (2 * n + 3)), n + 1);
+}
+constexpr double cos_c(double x) { return cos_series(x * x, 1.0, 0); }
+constexpr double sin_c(double x) { return sin_series(x * x, x, 0); }
+
+constexpr int32_t q14(double v) {
+  return v < 0 ? (int32_t)(v * 16384 - 0.5) : (int32_t)(v * 16384 + 0.5);
+}
+
+/*
+ * DC blocker  y = y1 - y1 / 2^k + (x - x1), corner ~ fs / (2 pi 2^k)
+*/
+constexpr uint32_t dc_shift(double ratio, uint32_t k = 0) {
+  return (k >= 15 || (double)(1UL << (k + 1)) > ratio * 1.41421356) ? k : dc_shift(ratio, k + 1);
+}
+constexpr uint32_t DC_SHIFT = dc_shift(SAMPLE_RATE / (PI_2 * DC_BLOCK_HZ));
+
+/*
+ * High pass biquad, RBJ audio EQ cookbook, coefficients in Q14
+*/
+constexpr double W0 = PI_2 * PL_HIGHPASS_HZ / SAMPLE_RATE;
+constexpr double COS_W0 = cos_c(W0);
+constexpr double ALPHA = sin_c(W0) / (2 * PL_HIGHPASS_Q);
+constexpr double HP_A0 = 1 + ALPHA;           // normalisation, HP_ prefix keeps clear of the
+                                              // B0 / B1 (binary.h) and A0 / A1 / A2 (pin) names
+constexpr int32_t HP_B0 = q14((1 + COS_W0) / 2 / HP_A0);
+constexpr int32_t HP_B1 = q14(-(1 + COS_W0) / HP_A0);
+constexpr int32_t HP_B2 = HP_B0;
+constexpr int32_t HP_A1 = q14(-2 * COS_W0 / HP_A0);
+constexpr int32_t HP_A2 = q14((1 - ALPHA) / HP_A0);
+
+static_assert(PL_HIGHPASS_HZ * 4 < SAMPLE_RATE, "PL_HIGHPASS_HZ is too high for SAMPLE_RATE");
+static_assert(DC_SHIFT > 0 && DC_SHIFT < 15, "DC_BLOCK_HZ doesn't fit SAMPLE_RATE");
+
+} // namespace sample_filter
+
+extern int32_t dcPrev,        // DC blocker previous input
+               dcAcc;         // DC blocker output, 8 fractional bits
+
+extern int32_t hpX1, hpX2,    // biquad input history
+               hpY1, hpY2,    // biquad output history
+               hpErr;         // biquad truncation error, fed back to avoid limit cycles
+
+extern uint32_t filterCycles; // worst case filter cycles during the last sample window (PROFILE_FILTER)
+
+/*
+ * Filter one ADC sample, returns the filtered sample centred on ADC_BITS / 2
+ * The worst case biquad sum is about 2^29 for a 12 bit input so 32 bits is enough
+*/
+inline int filter_sample(int sample) {
+  int32_t x;
+
+  #ifdef USE_DC_BLOCK
+  dcAcc += (sample - dcPrev) * 256 - (dcAcc >> sample_filter::DC_SHIFT);
+  dcPrev = sample;
+  x = dcAcc >> 8;
+  #else
+  x = sample - sample_filter::MID;
+  #endif
+
+  #ifdef USE_PL_HIGHPASS
+  int32_t acc = sample_filter::HP_B0 * x + sample_filter::HP_B1 * hpX1 + sample_filter::HP_B2 * hpX2
+              - sample_filter::HP_A1 * hpY1 - sample_filter::HP_A2 * hpY2 + hpErr;
+  int32_t y = acc >> 14;
+  hpErr = acc - y * 16384;
+  hpX2 = hpX1;
+  hpX1 = x;
+  hpY2 = hpY1;
+  hpY1 = y;
+  x = y;
+  #endif
+
+  return x + sample_filter::MID;
+}
+
+#endif
@@ -0,0 +1,131 @@
+#include <Arduino.h>
+#include "global_def.h"
+#include "sam_adc.h"          // SAMPLE_RATE
+
+#ifndef SAMPLE_PLAN_MODULE
+#define SAMPLE_PLAN_MODULE
+
+/*
+ * Compile time planner for timer triggered sampling (USE_TIMED_SAMPLING)
+ *
+ * TC5 overflows at exactly SAMPLE_RATE and starts each ADC conversion through the event
+ * system.  For the requested rate and the ADC resolution selected in global_def.h the
+ * planner picks
+ *   - the fastest ADC prescaler that keeps CLK_ADC within the datasheet limit
+ *   - the most hardware averaging (SAMPLENUM / ADJRES) that still fits in a sample period
+ *   - the longest sample time (SAMPLEN) that still fits, easier on the source impedance
+ *   - the TC5 prescaler and period that give the rate exactly
+ *
+ * Combinations that can't work fail with a static_assert so nothing is guessed at run time.
+ *
+ * NOTE: TC5 is also the timer tone() uses on the SAMD21 (Tone.cpp TONE_TC), don't call
+ *       tone() / noTone() with USE_TIMED_SAMPLING, it would reprogram the sample clock.
+ *
+ * Conversion time, in CLK_ADC half cycles, follows the datasheet:
+ *   sampling (SAMPLEN + 1) + propagation 2 * (1 + bits / 2 + gain delay), times the
+ *   number of averaged samples.  Averaging always converts at 12 bits (RESSEL = 16BIT).
+ * Only CONVERSION_BUDGET of the sample period is used to leave some margin.
+ *
+ * NOTE: written as single return constexpr functions, the framework builds with gnu++11
+*/
+
+namespace sample_plan {
+
+constexpr uint32_t GCLK_HZ = F_CPU;             // ADC and TC5 both run from GCLK0 (48 MHz)
+constexpr uint32_t ADC_CLK_MAX = 2100000UL;     // datasheet maximum CLK_ADC
+constexpr uint32_t RATE_MAX = 50000UL;          // more than this and the ADC ISR eats the CPU
+constexpr uint32_t SAMPLEN_MAX = 63;            // SAMPCTRL.SAMPLEN is 6 bits
+constexpr uint32_t AVG_LOG2_MAX = 4;            // up to 16 averaged samples ...
+constexpr uint32_t ADJRES_MAX = 4;              // ... and a result shift of up to 4 bits
+constexpr uint32_t GAIN_DELAY = 1;              // extra propagation cycle for GAIN DIV2
+constexpr uint32_t BUDGET_NUM = 3;              // CONVERSION_BUDGET = 3/4 of a sample period
+constexpr uint32_t BUDGET_DEN = 4;
+
+#if defined(ADC_12BITS)
+constexpr uint32_t BITS = 12;
+#elif defined(ADC_10BITS)
+constexpr uint32_t BITS = 10;
+#else
+constexpr uint32_t BITS = 8;
+#endif
+
+// ADC CTRLB.PRESCALER value 0 = DIV4 ... 7 = DIV512
+constexpr uint32_t adc_div(uint32_t prescaler) {
+  return 4UL << prescaler;
+}
+
+constexpr uint32_t adc_prescaler(uint32_t p = 0) {
+  return (p > 7 || GCLK_HZ / adc_div(p) <= ADC_CLK_MAX) ? p : adc_prescaler(p + 1);
+}
+
+constexpr uint32_t conversion_bits(uint32_t bits, uint32_t avgLog2) {
+  return avgLog2 ? 12 : bits;
+}
+
+constexpr uint32_t result_half_cycles(uint32_t samplen, uint32_t bits, uint32_t avgLog2) {
+  return ((samplen + 1) + 2 * (1 + conversion_bits(bits, avgLog2) / 2 + GAIN_DELAY)) << avgLog2;
+}
+
+// one result (all averaged conversions) fits in the budgeted part of a sample period
+constexpr bool fits(uint32_t p, uint32_t samplen, uint32_t bits, uint32_t avgLog2, uint32_t rate) {
+  return (uint64_t)result_half_cycles(samplen, bits, avgLog2) * adc_div(p) * rate * BUDGET_DEN
+             <= 2ULL * GCLK_HZ * BUDGET_NUM;
+}
+
+// the averaged 12 bit sum must shift back down to the selected resolution
+constexpr bool averaging_allowed(uint32_t bits, uint32_t avgLog2) {
+  return avgLog2 == 0 || avgLog2 + (12 - bits) <= ADJRES_MAX;
+}
+
+constexpr uint32_t avg_log2(uint32_t p, uint32_t bits, uint32_t rate, uint32_t n = AVG_LOG2_MAX) {
+  return (n == 0 || (averaging_allowed(bits, n) && fits(p, 0, bits, n, rate)))
+             ? n : avg_log2(p, bits, rate, n - 1);
+}
+
+constexpr uint32_t samplen(uint32_t p, uint32_t bits, uint32_t avgLog2, uint32_t rate, uint32_t s = SAMPLEN_MAX) {
+  return (s == 0 || fits(p, s, bits, avgLog2, rate)) ? s : samplen(p, bits, avgLog2, rate, s - 1);
+}
+
+constexpr uint32_t ressel(uint32_t bits, uint32_t avgLog2) {
+  return avgLog2 ? ADC_CTRLB_RESSEL_16BIT_Val
+       : bits == 12 ? ADC_CTRLB_RESSEL_12BIT_Val
+       : bits == 10 ? ADC_CTRLB_RESSEL_10BIT_Val
+       : ADC_CTRLB_RESSEL_8BIT_Val;
+}
+
+// TC CTRLA.PRESCALER value 0 = DIV1 ... 4 = DIV16, 5 = DIV64, 6 = DIV256, 7 = DIV1024
+constexpr uint32_t tc_div(uint32_t prescaler) {
+  return prescaler < 5 ? 1UL << prescaler : prescaler == 5 ? 64 : prescaler == 6 ? 256 : 1024;
+}
+
+constexpr bool tc_exact(uint32_t p, uint32_t rate) {
+  return GCLK_HZ % (tc_div(p) * rate) == 0 && GCLK_HZ / (tc_div(p) * rate) <= 65536UL;
+}
+
+constexpr uint32_t tc_prescaler(uint32_t rate, uint32_t p = 0) {
+  return (p > 7 || tc_exact(p, rate)) ? p : tc_prescaler(rate, p + 1);
+}
+
+#ifdef USE_TIMED_SAMPLING
+
+static_assert(SAMPLE_RATE > 0 && SAMPLE_RATE <= RATE_MAX, "SAMPLE_RATE is more than the ADC ISR can keep up with");
+
+constexpr uint32_t ADC_PRESCALER = adc_prescaler();
+constexpr uint32_t AVG_LOG2 = avg_log2(ADC_PRESCALER, BITS, SAMPLE_RATE);
+constexpr uint32_t SAMPLEN = samplen(ADC_PRESCALER, BITS, AVG_LOG2, SAMPLE_RATE);
+constexpr uint32_t ADJRES = AVG_LOG2 ? AVG_LOG2 + (12 - BITS) : 0;
+constexpr uint32_t RESSEL = ressel(BITS, AVG_LOG2);
+
+constexpr uint32_t TC_PRESCALER = tc_prescaler(SAMPLE_RATE);
+constexpr uint32_t TC_TOP = GCLK_HZ / (tc_div(TC_PRESCALER) * SAMPLE_RATE) - 1;
+
+static_assert(ADC_PRESCALER <= 7, "no ADC prescaler keeps CLK_ADC within the datasheet limit");
+static_assert(fits(ADC_PRESCALER, SAMPLEN, BITS, AVG_LOG2, SAMPLE_RATE),
+              "SAMPLE_RATE is too fast for one conversion at the selected ADC resolution");
+static_assert(TC_PRESCALER <= 7, "SAMPLE_RATE must divide 48 MHz exactly with a 16 bit timer period");
+
+#endif
+
+} // namespace sample_plan
+
+#endif
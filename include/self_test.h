@@ -0,0 +1,47 @@
+#include <Arduino.h>
+#include "global_def.h"
+
+#ifndef SELF_TEST_MODULE
+#define SELF_TEST_MODULE
+
+/*
+ * Closed loop self test and accuracy benchmark (USE_SELF_TEST)
+ *
+ * The DAC on A0 plays a sine table (tone plus an optional PL tone) fed by DMA, one
+ * halfword per TC3 overflow, so the CPU isn't involved.  Jumper A0 to A2 and the unit
+ * measures itself through the normal ADC_Handler() -> loop() -> display path.
+ *
+ * The tone amplitude is stepped from SELF_TEST_AMP_MIN to SELF_TEST_AMP_MAX.  For each
+ * step the main loop reports every display update with self_test_update() and the test
+ * records
+ *   - latency, time from the amplitude change to the first display update within
+ *     SELF_TEST_SETTLE_PCT of the expected peak to peak value
+ *   - error of the peak to peak and RMS (sine equivalent peak to peak) readings, averaged
+ *     over SELF_TEST_HOLD display updates after settling
+ * and prints a report on the serial port when the sweep is done.
+ *
+ * The table holds a whole number of tone AND PL cycles so the PL tone must share a large
+ * common factor with the tone e.g. 100, 150 or 250 Hz with a 1500 Hz tone.
+*/
+
+#define SELF_TEST_TONE_HZ 1500     // test tone frequency
+#define SELF_TEST_PL_HZ 100        // PL tone mixed in, 0 for none
+#define SELF_TEST_PL_PCT 10        // PL tone amplitude, % of the test tone amplitude
+#define SELF_TEST_UPDATE_HZ 48000  // DAC update rate
+#define SELF_TEST_TABLE_MAX 1024   // largest sine table (halfwords)
+
+#define SELF_TEST_STEPS 8          // number of amplitude steps
+#define SELF_TEST_AMP_MIN 40       // smallest test tone, DAC counts peak to peak (10 bits)
+#define SELF_TEST_AMP_MAX 600      // largest test tone, DAC counts peak to peak
+
+#define SELF_TEST_SETTLE_PCT 5     // a reading within this % of expected has settled
+#define SELF_TEST_HOLD 3           // display updates averaged after settling
+#define SELF_TEST_TIMEOUT 10       // display updates to wait before giving up on settling
+
+#define SELF_TEST_DMA_CH 11        // DMA channel feeding the DAC, the last one so it stays clear
+                                   // of libraries that allocate channels from 0 (ZeroDMA)
+
+void init_self_test();
+void self_test_update(float p2p, float rmsP2p);   // readings in ADC counts
+
+#endif
@@ -51,6 +51,18 @@
 #include "oled_mono.h"
 #endif
 
+#ifdef USE_AC_CYCLE_DETECT
+#include "sam_ac.h"
+#endif
+
+#ifdef PROFILE_FILTER
+#include "sam_filter.h"
+#endif
+
+#ifdef USE_SELF_TEST
+#include "self_test.h"
+#endif
+
 #define SL_WINDOW 64          // number of sample_window values to average for display         
 
 
@@ -66,7 +78,9 @@ void update_serial();
 
 float  winMaxDev,   // sample window deviation
        winDC,       // deviation P2P DC voltage
-       winAvgDC;    // sample window average DC value
+       winAvgDC,    // sample window average DC value
+       winRmsDev,   // sample window RMS deviation (sine equivalent peak to peak)
+       winFreq;     // average waveform frequency from the hardware cycle detector
 
 int led = LED_BUILTIN;
 
@@ -74,6 +88,9 @@ int sl_buf[SL_WINDOW];
 int sl_ptr = 0;
 float sl_avg = 0;
 
+uint32_t sl_rms_buf[SL_WINDOW];  // window RMS values in 1/16 ADC counts
+float sl_rms_avg = 0;
+
 float ADC_SCALE;
 
 void setup() {
@@ -107,8 +124,16 @@ void setup() {
       sl_buf[i] = 2048;
     }
 
+    #ifdef USE_AC_CYCLE_DETECT
+    init_ac_cycle_detect();  // Start the comparator / TC capture before the ADC needs it
+    #endif
+
     init_adc();  // Initialize the ADC.  See ADC constant in global_def.h
 
+    #ifdef USE_SELF_TEST
+    init_self_test();  // Start the DAC test signal, the report prints when the sweep is done
+    #endif
+
 }
 
 
@@ -155,6 +180,19 @@ void loop() {
    *   - winMaxDev          // maximum deviation during sample window
    * 
    *   - winAvgDC           // average DC during sample window
+   *
+   *   - winSumSq, winSumDev // sum of squared and plain sample deviations from the running
+   *                        // DC mean.  These give the RMS deviation which is much less
+   *                        // sensitive to single sample noise and JITTER than the peaks
+   *   - winRmsDev          // RMS deviation scaled by 2 * sqrt(2) so it reads the same as
+   *                        // winMaxDev for a clean sine wave
+   *
+   * With USE_AC_CYCLE_DETECT the waveform boundaries come from the analog comparator and
+   * TC4 instead of the direction change counting, see sam_ac.h
+   *
+   *   - wfPeriodAccumulator // sum of the captured waveform periods in AC_TC_HZ ticks
+   *   - wfPeriodCount      // count of captured waveform periods
+   *   - winFreq            // average waveform frequency during the sample window
   */
    if (displayReady) {
       PORT->Group[0].OUTSET.reg = PORT_PA15;      // Set Arduino pin 5 high for scope trigger      
@@ -172,6 +210,7 @@ void loop() {
       */
       //sl_buf[sl_ptr] = winMax;
       sl_buf[sl_ptr] = wfAccumulator / wfCount;
+      sl_rms_buf[sl_ptr] = window_rms_x16(winSumSq, winSumDev, winCount);
       sl_ptr++;
 
       if (sl_ptr > SL_WINDOW-1)  {
@@ -182,6 +221,12 @@ void loop() {
               sl_avg += sl_buf[i];
           }
           sl_avg = sl_avg / SL_WINDOW;
+
+          sl_rms_avg = 0;
+          for (int i=0;i < SL_WINDOW;i++) {
+              sl_rms_avg += sl_rms_buf[i];
+          }
+          sl_rms_avg = sl_rms_avg / SL_WINDOW / 16;    // back to ADC counts
            
           /*******************************************************************
            *  Use Arduino PIN9 / SAMD GPIO PA07 to control deviation scaling
@@ -199,6 +244,14 @@ void loop() {
           winAvgDC = (winAccumulator / winCount) * 3.3 / ADC_BITS;
           //winDC = sl_avg * Vcc / ADC_BITS;
           winDC = (winMax-winMin) *  ADC_SCALE / ADC_BITS;
+          winRmsDev = sl_rms_avg * 2.0 * M_SQRT2 * ADC_SCALE / ADC_BITS;
+
+          #ifdef USE_AC_CYCLE_DETECT
+          if (wfPeriodAccumulator > 0)          // periods are in AC_TC_HZ ticks
+              winFreq = (float)AC_TC_HZ * wfPeriodCount / wfPeriodAccumulator;
+          else
+              winFreq = 0;
+          #endif
 
           #ifdef SERIAL_DEBUG
           update_serial();
@@ -210,12 +263,16 @@ void loop() {
 
           #ifdef USE_OLED_MONO 
           //update_oled_mono(winMaxDev,winAvgDC);
-          update_oled_mono(winMaxDev,winAvgDC);
+          update_oled_mono(winMaxDev,winAvgDC,winRmsDev);
           #endif
        
           #ifdef USE_NEO_PIXEL
           update_neo_pixel(2561);
           #endif
+
+          #ifdef USE_SELF_TEST
+          self_test_update(sl_avg, sl_rms_avg * 2.0 * M_SQRT2);   // after the displays so latency includes them
+          #endif
        }  // end of sliding window code
       
       displayReady = false;                      // Clear the resultsReady flag     
@@ -234,6 +291,14 @@ void update_serial() {
     Serial.print("  winDiff ");Serial.print(winMax-winMin);
     Serial.print("  Vavg: "); Serial.print(winAvgDC, 4);
     Serial.print(F("  Vpp: ")); Serial.print(winDC, 4);
+    Serial.print(F("  Vrms: ")); Serial.print(sl_rms_avg * Vcc / ADC_BITS, 4);
+    Serial.print(F("  RMS Dev: ")); Serial.print(winRmsDev, 4);
+    #ifdef USE_AC_CYCLE_DETECT
+    Serial.print(F("  Freq: ")); Serial.print(winFreq, 1);
+    #endif
+    #ifdef PROFILE_FILTER
+    Serial.print(F("  Filt cyc: ")); Serial.print(filterCycles);
+    #endif
     Serial.print(F("  Max Dev: ")); Serial.println(winMaxDev, 4);
     //Serial.print(F("  Max Dev: ")); Serial.println(sl_avg/ADC_BITS*3.3, 4);
 }
@@ -16,7 +16,7 @@ Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, OLED_RESET); // Par
 
 char buff1[9];
 
-void update_oled_mono(float maxDev, float avgDC) {
+void update_oled_mono(float maxDev, float avgDC, float rmsDev) {
 // All the display commands below just populate the display buffer
  // Nothing diaplays until the display.display() command is executed
 
@@ -62,6 +62,10 @@ void update_oled_mono(float maxDev, float avgDC) {
       display.print(buff1[1]);
       display.print(buff1[2]);
 
+      display.setCursor(96,52);  // RMS deviation in small text under the "RMS" header
+      sprintf(buff1,"%04d",int((rmsDev+0.0005)*1000));  // Assemble print buffer, same units as maxDev
+      display.print(buff1);
+
       display.display();  // Send buffer to display unit  
 }
 
@@ -97,6 +101,9 @@ void init_oled_mono(){
       display.println(F("Average:")); // Display DC average value header
       display.setCursor(70,52);  // Position to display units
       display.println(F("VDC"));  // Display units (VDC)
+
+      display.setCursor(96,42);  // Position to display RMS deviation header
+      display.println(F("RMS"));  // Display RMS deviation header
  
       display.display();  // Send buffer to display unit
 }
\ No newline at end of file
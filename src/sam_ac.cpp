@@ -0,0 +1,100 @@
+#include "sam_ac.h"
+
+uint32_t wfPeriodAccumulator = 0;   // sum of cycle periods during sample window
+int wfPeriodCount = 0;              // count of cycle periods during sample window
+
+#ifdef AC_REF_DAC
+#define AC_MUXNEG AC_COMPCTRL_MUXNEG_DAC
+#else
+#define AC_MUXNEG AC_COMPCTRL_MUXNEG_VSCALE
+#endif
+
+
+void init_ac_cycle_detect() {
+  /*
+    Notes:
+      - The AC needs two clocks, GCLK_AC_DIG for the digital logic / filter and
+        GCLK_AC_ANA (32 KHz is plenty) for the analog comparator
+      - The comparator event output is a copy of the comparator state so the TC sees
+        both edges.  PPW capture restarts the counter on the rising edge and saves the
+        period in CC0.  Only channel 0 captures, an unread CC1 capture would raise ERR
+        every cycle
+      - The event channel uses the asynchronous path, no event channel clock needed
+      - Reading CC0 clears the MC0 capture flag
+  */
+
+    PM->APBCMASK.reg |= PM_APBCMASK_AC | PM_APBCMASK_EVSYS | PM_APBCMASK_TC4;
+
+    GCLK->CLKCTRL.reg = GCLK_CLKCTRL_ID_AC_DIG |       // AC digital clock from the 48 MHz GCLK0
+                        GCLK_CLKCTRL_GEN_GCLK0 |
+                        GCLK_CLKCTRL_CLKEN;
+    while(GCLK->STATUS.bit.SYNCBUSY);                  // Wait for synchronization
+    GCLK->CLKCTRL.reg = GCLK_CLKCTRL_ID_AC_ANA |       // AC analog clock from the 32 KHz GCLK1
+                        GCLK_CLKCTRL_GEN_GCLK1 |
+                        GCLK_CLKCTRL_CLKEN;
+    while(GCLK->STATUS.bit.SYNCBUSY);                  // Wait for synchronization
+    GCLK->CLKCTRL.reg = GCLK_CLKCTRL_ID_TC4_TC5 |      // TC4 clock from the 48 MHz GCLK0
+                        GCLK_CLKCTRL_GEN_GCLK0 |
+                        GCLK_CLKCTRL_CLKEN;
+    while(GCLK->STATUS.bit.SYNCBUSY);                  // Wait for synchronization
+
+    PORT->Group[0].PINCFG[4].bit.PMUXEN = 1;           // A3 / PA04 to analog function (AC AIN0)
+    PORT->Group[0].PMUX[4 >> 1].bit.PMUXE = PORT_PMUX_PMUXE_B_Val;
+
+    #ifdef AC_REF_DAC
+    PM->APBCMASK.reg |= PM_APBCMASK_DAC;
+    GCLK->CLKCTRL.reg = GCLK_CLKCTRL_ID_DAC | GCLK_CLKCTRL_GEN_GCLK0 | GCLK_CLKCTRL_CLKEN;
+    while(GCLK->STATUS.bit.SYNCBUSY);                  // Wait for synchronization
+    DAC->CTRLB.reg = DAC_CTRLB_REFSEL_AVCC |           // Full scale = Vcc
+                     DAC_CTRLB_IOEN;                   // Internal output only, A0 stays free
+    DAC->DATA.reg = AC_DAC_MID;
+    while(DAC->STATUS.bit.SYNCBUSY);                   // Wait for synchronization
+    DAC->CTRLA.bit.ENABLE = 1;
+    while(DAC->STATUS.bit.SYNCBUSY);                   // Wait for synchronization
+    #endif
+
+    /*
+     * TC4 16 bit counter, period capture on channel 0
+    */
+    AC_CAPTURE_TC->COUNT16.CTRLA.bit.ENABLE = 0;
+    while(AC_CAPTURE_TC->COUNT16.STATUS.bit.SYNCBUSY); // Wait for synchronization
+    AC_CAPTURE_TC->COUNT16.CTRLA.reg = TC_CTRLA_MODE_COUNT16 | AC_TC_PRESCALER;
+    while(AC_CAPTURE_TC->COUNT16.STATUS.bit.SYNCBUSY); // Wait for synchronization
+    AC_CAPTURE_TC->COUNT16.CTRLC.reg = TC_CTRLC_CPTEN0;
+    while(AC_CAPTURE_TC->COUNT16.STATUS.bit.SYNCBUSY); // Wait for synchronization
+    AC_CAPTURE_TC->COUNT16.EVCTRL.reg = TC_EVCTRL_TCEI | TC_EVCTRL_EVACT_PPW;
+    AC_CAPTURE_TC->COUNT16.INTFLAG.reg = TC_INTFLAG_MC0 | TC_INTFLAG_MC1 | TC_INTFLAG_OVF | TC_INTFLAG_ERR;
+    AC_CAPTURE_TC->COUNT16.CTRLA.bit.ENABLE = 1;
+    while(AC_CAPTURE_TC->COUNT16.STATUS.bit.SYNCBUSY); // Wait for synchronization
+
+    /*
+     * Event channel: comparator 0 -> TC4 event input
+    */
+    EVSYS->USER.reg = EVSYS_USER_CHANNEL(EVSYS_CH_AC_CAPTURE + 1) |   // channel n is selected with n + 1
+                      EVSYS_USER_USER(EVSYS_ID_USER_TC4_EVU);
+    EVSYS->CHANNEL.reg = EVSYS_CHANNEL_CHANNEL(EVSYS_CH_AC_CAPTURE) |
+                         EVSYS_CHANNEL_PATH_ASYNCHRONOUS |
+                         EVSYS_CHANNEL_EDGSEL_NO_EVT_OUTPUT |
+                         EVSYS_CHANNEL_EVGEN(EVSYS_ID_GEN_AC_COMP_0);
+
+    /*
+     * Comparator 0: A3 against the mid level reference, continuous mode with hysteresis
+     * and a 3 sample majority filter to keep noise from producing extra crossings
+    */
+    #ifndef AC_REF_DAC
+    AC->SCALER[0].reg = AC_SCALER_VALUE(AC_VSCALE_MID);
+    #endif
+    AC->COMPCTRL[0].reg = AC_COMPCTRL_MUXPOS_PIN0 |
+                          AC_MUXNEG |
+                          AC_COMPCTRL_SPEED_HIGH |
+                          AC_COMPCTRL_HYST |
+                          AC_COMPCTRL_FLEN_MAJ3 |
+                          AC_COMPCTRL_INTSEL_RISING |
+                          AC_COMPCTRL_OUT_OFF;
+    while(AC->STATUSB.bit.SYNCBUSY);                   // Wait for synchronization
+    AC->EVCTRL.reg = AC_EVCTRL_COMPEO0;                // Comparator 0 event output
+    AC->COMPCTRL[0].bit.ENABLE = 1;
+    while(AC->STATUSB.bit.SYNCBUSY);                   // Wait for synchronization
+    AC->CTRLA.bit.ENABLE = 1;                          // Enable the AC
+    while(AC->STATUSB.bit.SYNCBUSY);                   // Wait for synchronization
+}
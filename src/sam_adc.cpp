@@ -1,4 +1,15 @@
 #include "sam_adc.h"
+#ifdef USE_AC_CYCLE_DETECT
+#include "sam_ac.h"
+#endif
+#ifdef USE_TIMED_SAMPLING
+#include "sample_plan.h"
+#endif
+#if defined(USE_DC_BLOCK) || defined(USE_PL_HIGHPASS)
+#include "sam_filter.h"
+#elif defined(PROFILE_FILTER)
+#error "PROFILE_FILTER needs USE_DC_BLOCK or USE_PL_HIGHPASS"
+#endif
 //nclude <Arduino.h>
 
 #ifdef ADC_12BITS
@@ -31,6 +42,8 @@ int adcMax,
 int winMax,         // maximum ADC value during sample window
     winMin;         // minimum ADC value during sample window
 
+uint64_t winSumSq = 0;   // sum of squared deviations during sample window
+int32_t winSumDev = 0;   // sum of deviations during sample window
 
 
 
@@ -57,6 +70,26 @@ uint32_t _winAccumulator = 0;  //   working value in ADC ISR
 uint32_t _wfAccumulator = 0;
 int _winCount = 0;             //   working value in ADC ISR
 
+/*
+ * RMS working values.  Each sample is referenced to the DC mean of the previous window so
+ * the squares stay small (a 12 bit deviation squared fits in 32 bits) and only the window
+ * sum needs 64 bits.  The M0+ adds a 64 bit value in two instructions (ADDS/ADCS) so this
+ * costs a handful of cycles per sample.  _winSumDev lets the consumer remove whatever
+ * offset remains between the reference and the true mean of the window.
+*/
+int _dcRef = ADC_BITS / 2;     //   running DC mean used as the deviation reference
+int32_t _winSumDev = 0;        //   working value in ADC ISR
+uint64_t _winSumSq = 0;        //   working value in ADC ISR
+
+#ifdef USE_AC_CYCLE_DETECT
+uint32_t _wfPeriodAccumulator = 0;  //   working value in ADC ISR
+int _wfPeriodCount = 0;             //   working value in ADC ISR
+#endif
+
+#ifdef PROFILE_FILTER
+uint32_t _filterCycles = 0;         //   working value in ADC ISR
+#endif
+
 #define JITTER 5
 
 void ADC_Handler() {
@@ -91,6 +124,31 @@ void ADC_Handler() {
       _winAccumulator += _adcResult;
       _winCount++;                                    // signal display routines when defined value reached
                                                       // This will determine display update rate
+
+      /*
+       * With USE_DC_BLOCK / USE_PL_HIGHPASS the RMS sums and the waveform detection work on
+       * the filtered sample (centred on ADC_BITS / 2).  _winAccumulator and _adcMax / _adcMin
+       * keep the raw ADC value so the average DC and adcMin/Max telemetry are unchanged.
+      */
+      #ifdef USE_SAMPLE_FILTER
+      #ifdef PROFILE_FILTER
+      uint32_t start = SysTick->VAL;                  // SysTick counts down at the CPU clock
+      #endif
+      int sample = filter_sample(_adcResult);
+      #ifdef PROFILE_FILTER
+      int32_t cycles = start - SysTick->VAL;
+      if (cycles < 0)
+          cycles += SysTick->LOAD + 1;                // SysTick reloaded during the filter
+      if ((uint32_t)cycles > _filterCycles)
+          _filterCycles = cycles;
+      #endif
+      #else
+      int sample = _adcResult;
+      #endif
+
+      int dev = sample - _dcRef;                      // deviation from the running DC mean
+      _winSumDev += dev;
+      _winSumSq += (uint32_t)(dev * dev);             // 32 bit square, 64 bit accumulate
                                                  
 
       /*
@@ -103,6 +161,40 @@ void ADC_Handler() {
       else if (_adcResult < _adcMin)
           _adcMin = _adcResult;
 
+      #ifdef USE_AC_CYCLE_DETECT
+      /*
+       * The analog comparator and TC4 find the waveform boundaries in hardware.  Here we only
+       * track the waveform max and min, then close the waveform out when TC4 has captured a
+       * period.  The sample that arrives with the capture starts the next waveform.
+       * An overflow means the period was longer than the 16 bit counter, don't use it.
+      */
+      if (sample > _wfMax)
+          _wfMax = sample;
+      if (sample < _wfMin)
+          _wfMin = sample;
+
+      if (AC_CAPTURE_TC->COUNT16.INTFLAG.bit.MC0) {   // TC4 captured a complete waveform
+          if (AC_CAPTURE_TC->COUNT16.INTFLAG.bit.OVF)
+              AC_CAPTURE_TC->COUNT16.INTFLAG.reg = TC_INTFLAG_OVF | TC_INTFLAG_MC0;
+          else {
+              _wfPeriodAccumulator += AC_CAPTURE_TC->COUNT16.CC[0].reg;  // reading CC0 clears MC0
+              _wfPeriodCount++;
+          }
+          wfMax = _wfMax;                     // save the working value
+          wfMin = _wfMin;                     // save the working value
+          _wfDif = wfMax-wfMin;
+          _wfAccumulator += _wfDif;           // update the accumulated peak to peak values and counter
+          _wfCount++;
+
+          if (wfMax > _winMax)
+              _winMax = wfMax;
+          if (wfMin < _winMin)
+              _winMin = wfMin;
+
+          _wfMax = sample;                    // this sample starts the next waveform
+          _wfMin = sample;
+      }
+      #else
       /*
        * process ADC samples to look for waveform max and min values and setermine if the waveform
        * is rising or falling.  When the direction changes increment the _crossings variable, which
@@ -110,17 +202,17 @@ void ADC_Handler() {
        *  has been found
       */
       if (_rising) {
-          if (_adcResult > _wfMax)
-              _wfMax = _adcResult;
-          else if (_wfMax - _adcResult > JITTER) {
+          if (sample > _wfMax)
+              _wfMax = sample;
+          else if (_wfMax - sample > JITTER) {
               _rising = false;
               _crossings += 1;
               }
         }
       else {  // falling
-          if (_adcResult < _wfMin)
-          _wfMin = _adcResult;
-          else if (_adcResult-_wfMin > JITTER) {
+          if (sample < _wfMin)
+          _wfMin = sample;
+          else if (sample-_wfMin > JITTER) {
             _rising = true;
             _crossings += 1;
             }
@@ -150,6 +242,7 @@ void ADC_Handler() {
               _winMin = _wfMin;
           _crossings = 0;                     // reset to start looking for the next waveform
      }
+      #endif
     
       /*
        * The ADC sample counter _winCount has reached the sample window value
@@ -161,6 +254,18 @@ void ADC_Handler() {
           winAccumulator = _winAccumulator;   // sum of all ADC readings during sample window
           winCount = _winCount;               // count of all ADC readings, use to calculate
                                               // the average DC value
+
+          winSumSq = _winSumSq;               // RMS sums, the consumer does the square root
+          winSumDev = _winSumDev;
+          _dcRef += _winSumDev / _winCount;   // track the DC mean for the next window
+          _winSumSq = 0;
+          _winSumDev = 0;
+
+          #ifdef PROFILE_FILTER
+          filterCycles = _filterCycles;       // worst case filter cost during the window
+          _filterCycles = 0;
+          #endif
+
           _winAccumulator = 0;                // clear the working values for next sample period
           _winCount = 0;
       
@@ -169,6 +274,13 @@ void ADC_Handler() {
                                               // the average waveform value during th esample window
           _wfAccumulator = 0;                 // clear working values
           _wfCount = 0;
+
+          #ifdef USE_AC_CYCLE_DETECT
+          wfPeriodAccumulator = _wfPeriodAccumulator;   // sum and count of hardware captured periods
+          wfPeriodCount = _wfPeriodCount;
+          _wfPeriodAccumulator = 0;
+          _wfPeriodCount = 0;
+          #endif
           
           adcMax = _adcMax;                   // max and min ADC values during the sample window
           adcMin = _adcMin;
@@ -193,6 +305,86 @@ void ADC_Handler() {
 }
 
 
+/*
+ * Integer square root (bit by bit method), no floating point or divide needed
+*/
+uint32_t isqrt64(uint64_t value) {
+  uint64_t result = 0;
+  uint64_t bit = (uint64_t)1 << 62;
+
+  while (bit > value)
+      bit >>= 2;
+
+  while (bit != 0) {
+      if (value >= result + bit) {
+          value -= result + bit;
+          result = (result >> 1) + bit;
+      }
+      else
+          result >>= 1;
+      bit >>= 2;
+  }
+  return (uint32_t)result;
+}
+
+/*
+ * RMS deviation for a sample window in 1/16 ADC count units.  The samples were summed
+ * around a reference that may be slightly off the true window mean so the variance is
+ * corrected with the sum of deviations:
+ *
+ *   variance = (count * sumSq - sumDev^2) / count^2
+ *
+ * Scaled by 256 before the square root to keep four fractional bits.
+*/
+uint32_t window_rms_x16(uint64_t sumSq, int32_t sumDev, int count) {
+  if (count <= 0)
+      return 0;
+
+  int64_t n = count;
+  int64_t spread = n * (int64_t)sumSq - (int64_t)sumDev * sumDev;
+  if (spread <= 0)
+      return 0;
+
+  return isqrt64(((uint64_t)spread << 8) / (uint64_t)(n * n));
+}
+
+
+#ifdef USE_TIMED_SAMPLING
+/*
+ * TC5 runs in match frequency mode and overflows at exactly SAMPLE_RATE.  Each overflow
+ * event starts one ADC conversion through the event system, no CPU involvement.
+ * TC5 is also the tone() timer on the SAMD21 so tone() can't be used in this mode.
+*/
+void init_sample_timer() {
+    PM->APBCMASK.reg |= PM_APBCMASK_EVSYS | PM_APBCMASK_TC5;
+
+    GCLK->CLKCTRL.reg = GCLK_CLKCTRL_ID_TC4_TC5 |      // TC5 clock from the 48 MHz GCLK0
+                        GCLK_CLKCTRL_GEN_GCLK0 |
+                        GCLK_CLKCTRL_CLKEN;
+    while(GCLK->STATUS.bit.SYNCBUSY);                  // Wait for synchronization
+
+    EVSYS->USER.reg = EVSYS_USER_CHANNEL(EVSYS_CH_ADC_START + 1) |    // channel n is selected with n + 1
+                      EVSYS_USER_USER(EVSYS_ID_USER_ADC_START);
+    EVSYS->CHANNEL.reg = EVSYS_CHANNEL_CHANNEL(EVSYS_CH_ADC_START) |
+                         EVSYS_CHANNEL_PATH_ASYNCHRONOUS |
+                         EVSYS_CHANNEL_EDGSEL_NO_EVT_OUTPUT |
+                         EVSYS_CHANNEL_EVGEN(EVSYS_ID_GEN_TC5_OVF);
+
+    TC5->COUNT16.CTRLA.bit.ENABLE = 0;
+    while(TC5->COUNT16.STATUS.bit.SYNCBUSY);           // Wait for synchronization
+    TC5->COUNT16.CTRLA.reg = TC_CTRLA_MODE_COUNT16 |
+                             TC_CTRLA_WAVEGEN_MFRQ |   // CC0 is the period
+                             TC_CTRLA_PRESCALER(sample_plan::TC_PRESCALER);
+    while(TC5->COUNT16.STATUS.bit.SYNCBUSY);           // Wait for synchronization
+    TC5->COUNT16.CC[0].reg = sample_plan::TC_TOP;
+    while(TC5->COUNT16.STATUS.bit.SYNCBUSY);           // Wait for synchronization
+    TC5->COUNT16.EVCTRL.reg = TC_EVCTRL_OVFEO;         // Overflow event output
+    TC5->COUNT16.CTRLA.bit.ENABLE = 1;
+    while(TC5->COUNT16.STATUS.bit.SYNCBUSY);           // Wait for synchronization
+}
+#endif
+
+
 void init_adc() {
   /*
     Notes:
@@ -204,6 +396,8 @@ void init_adc() {
       - The ADC is configured to free run and generate result ready intrrupts.  The clock divider,
         sample length, and sample number parameters result in approx 23K samples / second which is 
         more than good enough for a 1500 Hz tune tone
+      - With USE_TIMED_SAMPLING the ADC doesn't free run, TC5 starts each conversion at exactly
+        SAMPLE_RATE and the clock divider, sample length and averaging come from sample_plan.h
   */
 
 
@@ -232,6 +426,19 @@ void init_adc() {
     while(ADC->STATUS.bit.SYNCBUSY);                   // Wait for synchronization
     ADC->INPUTCTRL.bit.MUXNEG = 0x18;                  // Set the negative analog input to GND
     while(ADC->STATUS.bit.SYNCBUSY);                   // Wait for synchronization
+    #ifdef USE_TIMED_SAMPLING
+    ADC->SAMPCTRL.bit.SAMPLEN = sample_plan::SAMPLEN;  // Set Sampling Time Length
+    ADC->CTRLB.reg = ADC_CTRLB_PRESCALER(sample_plan::ADC_PRESCALER) |  // Fastest legal CLK_ADC
+                     ADC_CTRLB_RESSEL(sample_plan::RESSEL);             // 16 bit when averaging
+    while(ADC->STATUS.bit.SYNCBUSY);                   // Wait for synchronization
+    ADC->INPUTCTRL.bit.GAIN = ADC_INPUTCTRL_GAIN_DIV2_Val;
+    while(ADC->STATUS.bit.SYNCBUSY);                   // Wait for synchronization
+    ADC->AVGCTRL.reg = ADC_AVGCTRL_SAMPLENUM(sample_plan::AVG_LOG2) |   // 2^n samples averaged
+                       ADC_AVGCTRL_ADJRES(sample_plan::ADJRES);         // shifted back to ADC_BITS
+    while(ADC->STATUS.bit.SYNCBUSY);                   // Wait for synchronization
+    ADC->EVCTRL.reg = ADC_EVCTRL_STARTEI;              // Start a conversion on each TC5 event
+    while(ADC->STATUS.bit.SYNCBUSY);                   // Wait for synchronization
+    #else
     ADC->SAMPCTRL.bit.SAMPLEN = 4;                     // Set Sampling Time Length 
     ADC->CTRLB.reg = ADC_CTRLB_PRESCALER_DIV16 |       // Divide ADC GCLK by 8 (48MHz/8, 136 KHz)
                      ADC_CTRLB_RESSEL_12BIT |          // Set the ADC resolution to 12 bits
@@ -253,6 +460,7 @@ void init_adc() {
     while(ADC->STATUS.bit.SYNCBUSY);                   // Wait for synchronization  
     ADC->AVGCTRL.bit.ADJRES = 2;
     while(ADC->STATUS.bit.SYNCBUSY);                   // Wait for synchronization  
+    #endif
  
     // Set the Nested Vector Interrupt Controller (NVIC) priority for the ADC to 0 (highest) 
     NVIC_SetPriority(ADC_IRQn, 0);
@@ -262,7 +470,11 @@ void init_adc() {
     ADC->INTENSET.reg = ADC_INTENSET_RESRDY;           // Generate interrupt on result ready (RESRDY)
      ADC->CTRLA.bit.ENABLE = 1;                         // Enable the ADC
     while(ADC->STATUS.bit.SYNCBUSY);                   // Wait for synchronization
+    #ifdef USE_TIMED_SAMPLING
+    init_sample_timer();                               // TC5 starts the conversions from here on
+    #else
     ADC->SWTRIG.bit.START = 1;                         // Initiate a software trigger to start an ADC conversion
     while(ADC->STATUS.bit.SYNCBUSY);                   // Wait for synchronization
+    #endif
   }
 
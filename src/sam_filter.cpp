@@ -0,0 +1,10 @@
+#include "sam_filter.h"
+
+int32_t dcPrev = sample_filter::MID,   // start at the bias level, no step at power up
+        dcAcc = 0;
+
+int32_t hpX1 = 0, hpX2 = 0,
+        hpY1 = 0, hpY2 = 0,
+        hpErr = 0;
+
+uint32_t filterCycles = 0;
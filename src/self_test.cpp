@@ -0,0 +1,273 @@
+#include "self_test.h"
+#include "sam_adc.h"
+
+#ifdef USE_SELF_TEST
+
+#ifdef USE_AC_CYCLE_DETECT
+#include "sam_ac.h"
+#ifdef AC_REF_DAC
+#error "USE_SELF_TEST needs the DAC, don't use AC_REF_DAC for the comparator reference"
+#endif
+#endif
+
+#ifndef SERIAL_DEBUG
+#error "USE_SELF_TEST prints its report on the serial port, define SERIAL_DEBUG"
+#endif
+
+namespace self_test {
+
+constexpr uint32_t gcd(uint32_t a, uint32_t b) {
+  return b == 0 ? a : gcd(b, a % b);
+}
+
+// The table repeats at BASE_HZ and holds a whole number of tone and PL cycles
+constexpr uint32_t BASE_HZ = SELF_TEST_PL_HZ ? gcd(SELF_TEST_TONE_HZ, SELF_TEST_PL_HZ) : SELF_TEST_TONE_HZ;
+constexpr uint32_t TABLE_LEN = SELF_TEST_UPDATE_HZ / BASE_HZ;
+constexpr uint32_t TONE_CYCLES = SELF_TEST_TONE_HZ / BASE_HZ;
+constexpr uint32_t PL_CYCLES = SELF_TEST_PL_HZ / BASE_HZ;
+constexpr uint32_t TC_TOP = F_CPU / (BASE_HZ * TABLE_LEN) - 1;    // TC3 runs at 48 MHz
+
+static_assert(TABLE_LEN <= SELF_TEST_TABLE_MAX, "SELF_TEST_PL_HZ and SELF_TEST_TONE_HZ need a larger common factor");
+static_assert(TABLE_LEN / TONE_CYCLES >= 8, "SELF_TEST_UPDATE_HZ needs at least 8 DAC updates per tone cycle");
+static_assert(TC_TOP <= 65535, "SELF_TEST_UPDATE_HZ is too low for a 16 bit TC3 period");
+static_assert(SELF_TEST_DMA_CH < DMAC_CH_NUM, "SELF_TEST_DMA_CH is not a DMAC channel");
+static_assert(SELF_TEST_AMP_MAX * (100 + SELF_TEST_PL_PCT) / 100 < 1024, "the largest test signal clips the DAC");
+
+} // namespace self_test
+
+struct SelfTestResult {
+  int amp;           // test tone, DAC counts peak to peak
+  float expected;    // expected reading, ADC counts peak to peak
+  float p2p;         // average peak to peak reading after settling
+  float rmsP2p;      // average RMS (sine equivalent peak to peak) reading after settling
+  long latency;      // ms from the amplitude change to a settled reading, -1 = timed out
+};
+
+SelfTestResult stResults[SELF_TEST_STEPS];
+
+uint16_t dacTable[self_test::TABLE_LEN];
+
+// Only used when nobody else has set up the DMAC, DMAC needs 16 byte alignment
+__attribute__((aligned(16))) DmacDescriptor dmaDescriptor[SELF_TEST_DMA_CH + 1];
+__attribute__((aligned(16))) DmacDescriptor dmaWriteback[SELF_TEST_DMA_CH + 1];
+
+int stStep = 0;              // current amplitude step
+int stUpdates = 0;           // display updates since the step started
+int stHold = 0;              // display updates averaged since settling
+bool stSettled = false;
+bool stDone = false;
+float stP2pSum = 0,
+      stRmsSum = 0;
+unsigned long stStepStart;   // millis() when the step amplitude was applied
+
+
+/*
+ * Fill the DAC table with the test tone and PL tone around mid scale.  The DMA keeps
+ * running while the table is rewritten, at worst one table period is a mix of the two.
+*/
+void fill_self_test_table(int amp) {
+  for (uint32_t i = 0; i < self_test::TABLE_LEN; i++) {
+      float phase = 2 * PI * i / self_test::TABLE_LEN;
+      float v = 512 + amp / 2.0 * sin(phase * self_test::TONE_CYCLES)
+                    + amp * SELF_TEST_PL_PCT / 200.0 * sin(phase * self_test::PL_CYCLES);
+      dacTable[i] = constrain((int)lround(v), 0, 1023);
+  }
+}
+
+int self_test_amp(int step) {
+  return SELF_TEST_AMP_MIN + (SELF_TEST_AMP_MAX - SELF_TEST_AMP_MIN) * step / (SELF_TEST_STEPS - 1);
+}
+
+void start_self_test_step() {
+  stResults[stStep].amp = self_test_amp(stStep);
+  stResults[stStep].expected = (float)stResults[stStep].amp * ADC_BITS / 1024;  // DAC and ADC full scale are both Vcc
+  stUpdates = 0;
+  stHold = 0;
+  stSettled = false;
+  stP2pSum = 0;
+  stRmsSum = 0;
+  fill_self_test_table(stResults[stStep].amp);
+  stStepStart = millis();
+}
+
+float self_test_error(float reading, float expected) {
+  return (reading - expected) * 100 / expected;
+}
+
+void self_test_report() {
+  float worstP2p = 0,
+        worstRms = 0;
+  long worstLatency = 0;
+
+  Serial.println();
+  Serial.print(F("Self test: tone ")); Serial.print(SELF_TEST_TONE_HZ);
+  Serial.print(F(" Hz  PL ")); Serial.print(SELF_TEST_PL_HZ);
+  Serial.print(F(" Hz at ")); Serial.print(SELF_TEST_PL_PCT); Serial.print(F("%"));
+  Serial.print(F("  DAC update ")); Serial.print(self_test::BASE_HZ * self_test::TABLE_LEN);
+  Serial.print(F(" Hz  table ")); Serial.println(self_test::TABLE_LEN);
+  Serial.println(F("DAC p2p  expected  p2p       err %    rms p2p   err %    latency ms"));
+
+  for (int i = 0; i < SELF_TEST_STEPS; i++) {
+      SelfTestResult &r = stResults[i];
+      float p2pErr = self_test_error(r.p2p, r.expected);
+      float rmsErr = self_test_error(r.rmsP2p, r.expected);
+
+      Serial.print(r.amp); Serial.print(F("      "));
+      Serial.print(r.expected, 1); Serial.print(F("     "));
+      Serial.print(r.p2p, 1); Serial.print(F("     "));
+      Serial.print(p2pErr, 2); Serial.print(F("     "));
+      Serial.print(r.rmsP2p, 1); Serial.print(F("     "));
+      Serial.print(rmsErr, 2); Serial.print(F("     "));
+      if (r.latency < 0)
+          Serial.println(F("timeout"));
+      else
+          Serial.println(r.latency);
+
+      if (fabs(p2pErr) > fabs(worstP2p))
+          worstP2p = p2pErr;
+      if (fabs(rmsErr) > fabs(worstRms))
+          worstRms = rmsErr;
+      if (r.latency < 0 || worstLatency < 0)
+          worstLatency = -1;
+      else if (r.latency > worstLatency)
+          worstLatency = r.latency;
+  }
+
+  Serial.print(F("Worst p2p error ")); Serial.print(worstP2p, 2);
+  Serial.print(F(" %  rms error ")); Serial.print(worstRms, 2);
+  Serial.print(F(" %  latency "));
+  if (worstLatency < 0)
+      Serial.println(F("timeout"));
+  else {
+      Serial.print(worstLatency); Serial.println(F(" ms"));
+  }
+}
+
+/*
+ * Called by the main loop after each display update with the readings in ADC counts
+*/
+void self_test_update(float p2p, float rmsP2p) {
+  if (stDone)
+      return;
+
+  SelfTestResult &r = stResults[stStep];
+  stUpdates++;
+
+  if (!stSettled) {
+      if (fabs(p2p - r.expected) <= r.expected * SELF_TEST_SETTLE_PCT / 100) {
+          stSettled = true;
+          r.latency = millis() - stStepStart;
+      }
+      else if (stUpdates >= SELF_TEST_TIMEOUT) {
+          stSettled = true;                    // measure the error anyway
+          r.latency = -1;
+      }
+      return;                                  // average the readings after this one
+  }
+
+  stP2pSum += p2p;
+  stRmsSum += rmsP2p;
+  stHold++;
+  if (stHold < SELF_TEST_HOLD)
+      return;
+
+  r.p2p = stP2pSum / stHold;
+  r.rmsP2p = stRmsSum / stHold;
+
+  stStep++;
+  if (stStep < SELF_TEST_STEPS)
+      start_self_test_step();
+  else {
+      fill_self_test_table(0);                 // back to a quiet mid scale output
+      stDone = true;
+      self_test_report();
+  }
+}
+
+void init_self_test() {
+  /*
+    Notes:
+      - The DAC output is A0 / PA02 (peripheral function B), reference is AVCC so the full
+        scale matches the ADC (GAIN DIV2 with the VDDANA / 2 reference)
+      - TC3 overflows at the DAC update rate and triggers one DMA beat (halfword) per
+        overflow.  The descriptor links back to itself so the table plays forever
+      - TC3 must be free, e.g. no analogWrite() on a pin that uses TC3 for PWM
+      - If the DMAC is already enabled (another DMA user) its descriptor tables are left
+        alone and only channel SELF_TEST_DMA_CH is set up in them, otherwise the DMAC is
+        reset and pointed at the tables here
+      - Jumper A0 to A2
+  */
+
+    PM->APBCMASK.reg |= PM_APBCMASK_DAC | PM_APBCMASK_TC3;
+    PM->AHBMASK.reg |= PM_AHBMASK_DMAC;
+    PM->APBBMASK.reg |= PM_APBBMASK_DMAC;
+
+    GCLK->CLKCTRL.reg = GCLK_CLKCTRL_ID_DAC |          // DAC clock from the 48 MHz GCLK0
+                        GCLK_CLKCTRL_GEN_GCLK0 |
+                        GCLK_CLKCTRL_CLKEN;
+    while(GCLK->STATUS.bit.SYNCBUSY);                  // Wait for synchronization
+    GCLK->CLKCTRL.reg = GCLK_CLKCTRL_ID_TCC2_TC3 |     // TC3 clock from the 48 MHz GCLK0
+                        GCLK_CLKCTRL_GEN_GCLK0 |
+                        GCLK_CLKCTRL_CLKEN;
+    while(GCLK->STATUS.bit.SYNCBUSY);                  // Wait for synchronization
+
+    PORT->Group[0].PINCFG[2].bit.PMUXEN = 1;           // A0 / PA02 to the DAC output
+    PORT->Group[0].PMUX[2 >> 1].bit.PMUXE = PORT_PMUX_PMUXE_B_Val;
+
+    DAC->CTRLB.reg = DAC_CTRLB_REFSEL_AVCC |           // Full scale = Vcc
+                     DAC_CTRLB_EOEN;                   // Drive the A0 pin
+    DAC->DATA.reg = 512;                               // Start at mid scale
+    while(DAC->STATUS.bit.SYNCBUSY);                   // Wait for synchronization
+    DAC->CTRLA.bit.ENABLE = 1;
+    while(DAC->STATUS.bit.SYNCBUSY);                   // Wait for synchronization
+
+    start_self_test_step();                            // First amplitude in the table
+
+    /*
+     * DMA channel: table -> DAC DATA, one halfword per TC3 overflow
+    */
+    if (!DMAC->CTRL.bit.DMAENABLE) {                   // Nobody else is using the DMAC
+        DMAC->CTRL.reg = DMAC_CTRL_SWRST;
+        while(DMAC->CTRL.bit.SWRST);
+        DMAC->BASEADDR.reg = (uint32_t)dmaDescriptor;
+        DMAC->WRBADDR.reg = (uint32_t)dmaWriteback;
+        DMAC->CTRL.reg = DMAC_CTRL_DMAENABLE | DMAC_CTRL_LVLEN(0xf);
+    }
+
+    DmacDescriptor *desc = (DmacDescriptor *)DMAC->BASEADDR.reg + SELF_TEST_DMA_CH;
+    desc->BTCTRL.reg = DMAC_BTCTRL_VALID |
+                       DMAC_BTCTRL_BEATSIZE_HWORD |
+                       DMAC_BTCTRL_SRCINC;
+    desc->BTCNT.reg = self_test::TABLE_LEN;
+    desc->SRCADDR.reg = (uint32_t)(dacTable + self_test::TABLE_LEN);  // end address when incrementing
+    desc->DSTADDR.reg = (uint32_t)&DAC->DATA.reg;
+    desc->DESCADDR.reg = (uint32_t)desc;               // link to itself, the table loops
+
+    DMAC->CHID.reg = DMAC_CHID_ID(SELF_TEST_DMA_CH);
+    DMAC->CHCTRLA.reg &= ~DMAC_CHCTRLA_ENABLE;
+    while(DMAC->CHCTRLA.bit.ENABLE);
+    DMAC->CHCTRLA.reg = DMAC_CHCTRLA_SWRST;
+    while(DMAC->CHCTRLA.bit.SWRST);
+    DMAC->CHCTRLB.reg = DMAC_CHCTRLB_LVL(0) |
+                        DMAC_CHCTRLB_TRIGSRC(TC3_DMAC_ID_OVF) |
+                        DMAC_CHCTRLB_TRIGACT_BEAT;
+    DMAC->CHCTRLA.reg = DMAC_CHCTRLA_ENABLE;
+
+    /*
+     * TC3 paces the DAC updates
+    */
+    TC3->COUNT16.CTRLA.bit.ENABLE = 0;
+    while(TC3->COUNT16.STATUS.bit.SYNCBUSY);           // Wait for synchronization
+    TC3->COUNT16.CTRLA.reg = TC_CTRLA_MODE_COUNT16 |
+                             TC_CTRLA_WAVEGEN_MFRQ |   // CC0 is the period
+                             TC_CTRLA_PRESCALER_DIV1;
+    while(TC3->COUNT16.STATUS.bit.SYNCBUSY);           // Wait for synchronization
+    TC3->COUNT16.CC[0].reg = self_test::TC_TOP;
+    while(TC3->COUNT16.STATUS.bit.SYNCBUSY);           // Wait for synchronization
+    TC3->COUNT16.CTRLA.bit.ENABLE = 1;
+    while(TC3->COUNT16.STATUS.bit.SYNCBUSY);           // Wait for synchronization
+
+    Serial.println(F("Self test running, jumper A0 to A2"));
+}
+
+#endif